@@ -1,18 +1,62 @@
 #include <iostream>
 #include <limits>
 #include <chrono>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
 
 #include "chess.hpp"
 using namespace chess;
 
 Board board;
 
-int nodes = 0;
-
 const bool use_tt = true;
 
-const int INFINITY = std::numeric_limits<int>::max();
-const int MATE_SCORE = 1000000;
+const int MATE_SCORE = 32000;
+const int SCORE_INFINITY = MATE_SCORE + 1; // finite, so it can be negated, widened and stored in 16 bits
+const int MAX_PLY = 256;
+const int MATE_IN_MAX_PLY = MATE_SCORE - MAX_PLY;
+const int SCORE_NONE = MATE_SCORE + 2; // static eval of a node in check, which has none
+
+const int LMR_MIN_DEPTH = 3;
+
+// Late move reductions by [depth][move number], filled once at startup
+int lmr_reductions[MAX_PLY][constants::MAX_MOVES];
+
+void init_reductions() {
+    for (int depth = 1; depth < MAX_PLY; ++depth) {
+        for (int move_number = 1; move_number < constants::MAX_MOVES; ++move_number) {
+            lmr_reductions[depth][move_number] = static_cast<int>(0.75 + std::log(depth) * std::log(move_number) / 2.25);
+        }
+    }
+}
+
+const int RFP_MAX_DEPTH = 6;
+const int RFP_MARGIN = 80;
+
+const int FP_MAX_DEPTH = 3;
+const int FP_BASE_MARGIN = 100;
+const int FP_MARGIN = 100;
+
+const int CHP_MAX_DEPTH = 3;
+const int CHP_MARGIN = 1024;
+
+const int NMP_MIN_DEPTH = 3;
+const int NMP_VERIFICATION_DEPTH = 10;
+
+const int ASP_MIN_DEPTH = 4;
+const int ASP_WINDOW = 30;
+
+const int SE_MIN_DEPTH = 6;
+const int SE_TT_DEPTH_MARGIN = 3;
+
+// Set once the search has to end, by the main thread when it runs out of time or finishes.
+// Every thread only polls it; a node that sees it returns at once and stores nothing.
+std::atomic<bool> search_stopped{false};
+const int TIME_CHECK_INTERVAL = 1024; // nodes between clock reads of the main thread
 
 // Helpers
 bool is_capture_move(const chess::Move& move, const chess::Board& board) {
@@ -22,94 +66,56 @@ bool is_capture_move(const chess::Move& move, const chess::Board& board) {
 }
 
 // --- Evaluation Functions ---
-int hce_pieces(const Board board) {
-    int score = 0;
-
-    const int PAWN_VALUE = 100;
-    const int KNIGHT_VALUE = 320;
-    const int BISHOP_VALUE = 330;
-    const int ROOK_VALUE = 500;
-    const int QUEEN_VALUE = 900;
+// Material, king proximity, attacked pieces and advancement for the pieces of color c, from white's
+// point of view. Templated on the color like movegen::legalmoves, so every white/black choice is made
+// at compile time instead of once per square.
+template <Color::underlying c>
+int hce_side(const Board& board) {
+    const PieceType PIECE_TYPES[5] = {PieceType::PAWN, PieceType::KNIGHT, PieceType::BISHOP, PieceType::ROOK, PieceType::QUEEN};
+    const int PIECE_VALUES[5] = {100, 320, 330, 500, 900}; // King has no material value in this eval
 
     const double PROXIMITY_BONUS_PER_UNIT_DISTANCE = 15;
-    const double PAWN_ADVANCE_BONUS = 15;
-    const double OTHER_ADVANCE_BONUS = 7;
-
-    chess::Square white_king_sq = board.kingSq(Color::WHITE);
-    chess::Square black_king_sq = board.kingSq(Color::BLACK);
-
-    for (int i = 0; i < 64; ++i) {
-        chess::Square sq = static_cast<chess::Square>(i);
-        chess::Piece piece = board.at(sq);
-
-        if (piece == chess::Piece::NONE) continue;
-
-        // material evaluation
-        int piece_value = 0;
-        switch (piece.type()) {
-            case PieceType(PieceType::PAWN):   piece_value = PAWN_VALUE;   break;
-            case PieceType(PieceType::KNIGHT): piece_value = KNIGHT_VALUE; break;
-            case PieceType(PieceType::BISHOP): piece_value = BISHOP_VALUE; break;
-            case PieceType(PieceType::ROOK):   piece_value = ROOK_VALUE;   break;
-            case PieceType(PieceType::QUEEN):  piece_value = QUEEN_VALUE;  break;
-            case PieceType(PieceType::KING):   piece_value = 0;            break; // King has no material value in this eval
-            default: break;
-        }
-
-        // bonus for being closer to the enemy king
-        int bonus = 0;
-        if (piece.type() != chess::PieceType::KING) { // Kings don't get proximity bonus to themselves
-            int dx, dy;
-            if (piece.color() == chess::Color::WHITE) {
-                // Calculate distance to black king
-                dx = std::abs(sq.file() - black_king_sq.file());
-                dy = std::abs(sq.rank() - black_king_sq.rank());
-                int manhattan_distance = dx + dy;
-                bonus = (14 - manhattan_distance) * (1 / PROXIMITY_BONUS_PER_UNIT_DISTANCE) * piece_value;
-            } else { // Black piece
-                // Calculate distance to white king
-                dx = std::abs(sq.file() - white_king_sq.file());
-                dy = std::abs(sq.rank() - white_king_sq.rank());
-                int manhattan_distance = dx + dy;
-                bonus = (14 - manhattan_distance) * (1 / PROXIMITY_BONUS_PER_UNIT_DISTANCE) * piece_value;
-            }
-        }
-        if (piece.color() == chess::Color::WHITE) {
-            score += bonus;
-        } else {
-            score -= bonus;
-        }
+    const int PAWN_ADVANCE_BONUS = 15;
+    const int OTHER_ADVANCE_BONUS = 7;
 
-        // an attacked piece is effectively a lost piece (if your pieces are attacked, deduct their value)
-        if(board.isAttacked(sq, Color::WHITE)) {
-            score += piece_value/4;
-        }
-        else if(board.isAttacked(sq, Color::BLACK)) {
-            score -= piece_value/4;
-        }
+    constexpr int sign = c == Color::underlying::WHITE ? 1 : -1;
+    const chess::Square their_king_sq = board.kingSq(~Color(c));
 
-        // TODO: reward pawns for being more up the board
-        if (piece.type() == chess::PieceType::PAWN) {
-            int rank = sq.rank(); // 0 for rank 1, 7 for rank 8
-            if (piece.color() == chess::Color::WHITE) {
-                score += (rank - 1) * PAWN_ADVANCE_BONUS;
-            } else { // Black pawn
-                score -= (6 - rank) * PAWN_ADVANCE_BONUS;
+    int score = 0;
+    for (int i = 0; i < 5; ++i) {
+        const int piece_value = PIECE_VALUES[i];
+        const int advance_bonus = i == 0 ? PAWN_ADVANCE_BONUS : OTHER_ADVANCE_BONUS;
+
+        Bitboard pieces = board.pieces(PIECE_TYPES[i], c);
+        while (pieces) {
+            const chess::Square sq = pieces.pop();
+
+            // bonus for being closer to the enemy king
+            int manhattan_distance = std::abs(sq.file() - their_king_sq.file()) + std::abs(sq.rank() - their_king_sq.rank());
+            int bonus = (14 - manhattan_distance) * (1 / PROXIMITY_BONUS_PER_UNIT_DISTANCE) * piece_value;
+            score += sign * bonus;
+
+            // an attacked piece is effectively a lost piece (if your pieces are attacked, deduct their value)
+            if(board.isAttacked(sq, Color::WHITE)) {
+                score += piece_value/4;
             }
-        }
-        else if (piece.type() != chess::PieceType::KING){
-            int rank = sq.rank(); // 0 for rank 1, 7 for rank 8
-            if (piece.color() == chess::Color::WHITE) {
-                score += (rank - 1) * OTHER_ADVANCE_BONUS;
-            } else { // Black pawn
-                score -= (6 - rank) * OTHER_ADVANCE_BONUS;
+            else if(board.isAttacked(sq, Color::BLACK)) {
+                score -= piece_value/4;
             }
+
+            // reward pieces, and pawns most, for being more up the board
+            int relative_rank = c == Color::underlying::WHITE ? int(sq.rank()) : 7 - int(sq.rank());
+            score += sign * (relative_rank - 1) * advance_bonus;
         }
     }
 
     return score;
 }
 
+int hce_pieces(const Board& board) {
+    return hce_side<Color::underlying::WHITE>(board) + hce_side<Color::underlying::BLACK>(board);
+}
+
 // Helper function to get the material value of a piece
 int get_piece_value(chess::PieceType pt) {
     switch (pt) {
@@ -123,84 +129,487 @@ int get_piece_value(chess::PieceType pt) {
     }
 }
 
-// Comparison function for sorting moves by MVV-LVA
-bool compareMovesMVVLVA(const chess::Move& a, const chess::Move& b, const chess::Board& board) {
-    bool a_is_capture = board.at(a.to()) != chess::Piece::NONE;
-    bool b_is_capture = board.at(b.to()) != chess::Piece::NONE;
+// --- Move Ordering ---
 
-    if (a_is_capture && b_is_capture) {
-        int a_victim_value = get_piece_value(board.at(a.to()).type());
-        int a_attacker_value = get_piece_value(board.at(a.from()).type());
+// Static Exchange Evaluation: true if the exchange sequence started by move on its target square
+// wins at least threshold for the side to move, with both sides always recapturing with their least
+// valuable piece. Sliders hidden behind a piece that captured join in as x-rays.
+bool see(const Board& board, Move move, int threshold) {
+    // castling, en passant and promotions are not worth the special cases
+    if (move.typeOf() != Move::NORMAL) return 0 >= threshold;
 
-        int b_victim_value = get_piece_value(board.at(b.to()).type());
-        int b_attacker_value = get_piece_value(board.at(b.from()).type());
+    const Square from = move.from();
+    const Square to = move.to();
 
-        // Sort by victim value descending, then by attacker value ascending
-        if (a_victim_value != b_victim_value) {
-            return a_victim_value > b_victim_value;
-        } else {
-            return a_attacker_value < b_attacker_value;
+    // what we win if they don't recapture
+    int swap = get_piece_value(board.at<PieceType>(to)) - threshold;
+    if (swap < 0) return false;
+
+    // what we still have if they do and we stop there
+    swap = get_piece_value(board.at<PieceType>(from)) - swap;
+    if (swap <= 0) return true;
+
+    const Bitboard diagonal_sliders = board.pieces(PieceType::BISHOP, PieceType::QUEEN);
+    const Bitboard straight_sliders = board.pieces(PieceType::ROOK, PieceType::QUEEN);
+
+    Bitboard occupied = board.occ() ^ Bitboard::fromSquare(from) ^ Bitboard::fromSquare(to);
+    Bitboard attackers = attacks::attackers(board, Color::WHITE, to) | attacks::attackers(board, Color::BLACK, to);
+    // the moving piece may have been blocking a slider
+    attackers |= (attacks::bishop(to, occupied) & diagonal_sliders) | (attacks::rook(to, occupied) & straight_sliders);
+
+    Color stm = board.sideToMove();
+    bool result = true;
+
+    while (true) {
+        stm = ~stm;
+        attackers &= occupied;
+
+        Bitboard stm_attackers = attackers & board.us(stm);
+        if (!stm_attackers) break;
+
+        result = !result;
+
+        PieceType attacker = PieceType::NONE;
+        Bitboard attacker_bb;
+        for (auto pt : {PieceType::PAWN, PieceType::KNIGHT, PieceType::BISHOP, PieceType::ROOK, PieceType::QUEEN, PieceType::KING}) {
+            attacker_bb = stm_attackers & board.pieces(pt);
+            if (attacker_bb) {
+                attacker = pt;
+                break;
+            }
+        }
+
+        // the king can only take if nothing can take it back
+        if (attacker == PieceType::KING) {
+            return (attackers & ~board.us(stm)) ? !result : result;
+        }
+
+        swap = get_piece_value(attacker) - swap;
+        if (swap < static_cast<int>(result)) break;
+
+        occupied ^= Bitboard::fromSquare(attacker_bb.lsb());
+
+        // x-rays behind the piece that just captured
+        if (attacker == PieceType::PAWN || attacker == PieceType::BISHOP || attacker == PieceType::QUEEN) {
+            attackers |= attacks::bishop(to, occupied) & diagonal_sliders;
+        }
+        if (attacker == PieceType::ROOK || attacker == PieceType::QUEEN) {
+            attackers |= attacks::rook(to, occupied) & straight_sliders;
         }
-    } else if (a_is_capture) {
-        return true; // Captures before non-captures
-    } else if (b_is_capture) {
-        return false; // Non-captures after captures
     }
 
-    return false;
+    return result;
 }
 
-// Function to sort a Movelist by MVV-LVA ordering
-std::vector<chess::Move> sortMovesMVVLVA(const chess::Movelist& moves, const chess::Board& board) {
-    std::vector<chess::Move> sorted_moves;
-    for (const auto& move : moves) {
-        sorted_moves.push_back(move);
+// Per-thread statistics on which quiet moves caused cutoffs, shared by all nodes of that thread's search
+const int HISTORY_MAX = 16384;
+
+// [piece][to] of a quiet move, one such table per earlier move (piece, to) in the continuation history
+using PieceToHistory = int16_t[12][64];
+
+struct HistoryTables {
+    int16_t butterfly[2][64][64]; // [color][from][to]
+    Move counter_moves[12][64];   // [piece][to] of the move this one refuted
+
+    // Continuation history, [piece][to] of the move one or two plies back, then [piece][to] of this one.
+    // The 1-ply and 2-ply lookups share these tables, so this move's color has to be in the index or the
+    // opponent's replies and our own follow-ups would land in the same entries. 13 * 64 * 12 * 64 * 2 bytes = 1.2 MB.
+    // Row Piece::NONE is a sentinel for null moves and plies before the root.
+    PieceToHistory continuation[13][64];
+
+    // [moving piece][to][captured piece type], PieceType::NONE for quiet promotions
+    int16_t capture[12][64][7];
+
+    void clear() {
+        std::fill(&butterfly[0][0][0], &butterfly[0][0][0] + sizeof(butterfly) / sizeof(int16_t), 0);
+        std::fill(&counter_moves[0][0], &counter_moves[0][0] + sizeof(counter_moves) / sizeof(Move), Move(Move::NO_MOVE));
+        std::fill(&continuation[0][0][0][0], &continuation[0][0][0][0] + sizeof(continuation) / sizeof(int16_t), 0);
+        std::fill(&capture[0][0][0], &capture[0][0][0] + sizeof(capture) / sizeof(int16_t), 0);
     }
 
-    std::sort(sorted_moves.begin(), sorted_moves.end(), [&](const chess::Move& a, const chess::Move& b) {
-        return compareMovesMVVLVA(a, b, board);
-    });
+    int capture_score(const Board& board, Move move) const {
+        return capture[board.at(move.from())][move.to().index()][captured_type(board, move)];
+    }
 
-    return sorted_moves;
+    void update_capture(const Board& board, Move move, int bonus) {
+        update_entry(capture[board.at(move.from())][move.to().index()][captured_type(board, move)], bonus);
+    }
+
+    static PieceType captured_type(const Board& board, Move move) {
+        if (move.typeOf() == Move::ENPASSANT) return PieceType::PAWN;
+        return board.at<PieceType>(move.to());
+    }
+
+    PieceToHistory* continuation_table(Piece piece, Square to) { return &continuation[piece][to.index()]; }
+    PieceToHistory* sentinel() { return &continuation[static_cast<int>(Piece::NONE)][0]; }
+    const PieceToHistory* sentinel() const { return &continuation[static_cast<int>(Piece::NONE)][0]; }
+
+    // butterfly plus the continuation histories of the last two moves
+    int quiet_score(Color color, Move move, Piece piece, const PieceToHistory* const cont_hist[2]) const {
+        return butterfly[color][move.from().index()][move.to().index()]
+             + (*cont_hist[0])[piece][move.to().index()]
+             + (*cont_hist[1])[piece][move.to().index()];
+    }
+
+    // Gravity update: the closer an entry is to HISTORY_MAX the less a bonus moves it, so entries stay bounded
+    // and moves that stop working drift back towards zero
+    static void update_entry(int16_t& entry, int bonus) {
+        entry += bonus - entry * std::abs(bonus) / HISTORY_MAX;
+    }
+
+    void update_quiet(Color color, Move move, Piece piece, PieceToHistory* const cont_hist[2], int bonus) {
+        update_entry(butterfly[color][move.from().index()][move.to().index()], bonus);
+        // no previous move (root, null move) means no table, the sentinel row has to stay all zeros
+        for (int i = 0; i < 2; ++i) {
+            if (cont_hist[i] != sentinel()) {
+                update_entry((*cont_hist[i])[piece][move.to().index()], bonus);
+            }
+        }
+    }
+};
+
+int history_bonus(int depth) {
+    return std::min(16 * depth * depth, 1200);
 }
 
-struct TranspositionTableEntry {
-    uint64_t hash_key;
-    Move bestmove;
-    int depth;
+enum PickerStage {
+    STAGE_TT_MOVE,
+    STAGE_GEN_CAPTURES,
+    STAGE_GOOD_CAPTURES,
+    STAGE_REFUTATIONS,
+    STAGE_GEN_QUIETS,
+    STAGE_QUIETS,
+    STAGE_BAD_CAPTURES,
+    STAGE_DONE,
+};
+
+// Hands out the moves of a node one at a time, best first, generating and scoring each group only when it is
+// reached. A node that cuts off on the tt move never generates anything else. Moves are scored in place in
+// their Move::score() and picked with a partial selection sort, so nothing is sorted that is never searched.
+class MovePicker {
+   public:
+    // killer1, killer2 and counter are quiet moves that refuted siblings or the previous move before,
+    // they are tried right after the good captures. cont_hist are the continuation histories of the last two moves.
+    MovePicker(const Board& board, const HistoryTables& history, const PieceToHistory* const cont_hist[2],
+               Move tt_move, Move killer1, Move killer2, Move counter)
+        : board(board), history(history), cont_hist{cont_hist[0], cont_hist[1]},
+          tt_move(tt_move), refutations{killer1, killer2, counter}, captures_only(false) {
+        stage = is_legal(tt_move) ? STAGE_TT_MOVE : STAGE_GEN_CAPTURES;
+    }
+
+    // For qsearch. captures_only: no tt move, captures and queen promotions only, no SEE-losing captures.
+    // Otherwise all moves, to search every evasion when in check.
+    MovePicker(const Board& board, const HistoryTables& history, bool captures_only)
+        : board(board), history(history), cont_hist{history.sentinel(), history.sentinel()},
+          tt_move(Move::NO_MOVE), refutations{Move::NO_MOVE, Move::NO_MOVE, Move::NO_MOVE}, captures_only(captures_only) {
+        stage = STAGE_GEN_CAPTURES;
+    }
+
+    // Returns Move::NO_MOVE once every move has been handed out
+    Move next() {
+        switch (stage) {
+            case STAGE_TT_MOVE:
+                stage = STAGE_GEN_CAPTURES;
+                return tt_move;
+
+            case STAGE_GEN_CAPTURES:
+                movegen::legalmoves<movegen::MoveGenType::CAPTURE>(captures, board);
+                if (captures_only) {
+                    add_quiet_queen_promotions();
+                }
+                for (auto& move : captures) {
+                    score_capture(move);
+                }
+                stage = STAGE_GOOD_CAPTURES;
+                [[fallthrough]];
+
+            case STAGE_GOOD_CAPTURES:
+                while (capture_index < captures.size()) {
+                    Move move = pick_best(captures, capture_index);
+                    if (move == tt_move) continue;
+
+                    // losing captures are parked at the front of the list and tried after the quiets,
+                    // qsearch does not search them at all
+                    if (!see(board, move, 0)) {
+                        captures[bad_capture_end++] = move;
+                        continue;
+                    }
+                    return move;
+                }
+                stage = captures_only ? STAGE_DONE : STAGE_REFUTATIONS;
+                return next();
+
+            case STAGE_REFUTATIONS:
+                while (refutation_index < 3) {
+                    Move move = refutations[refutation_index++];
+                    if (is_refutation_duplicate(move) || board.isCapture(move) || !is_legal(move)) continue;
+                    return move;
+                }
+                stage = STAGE_GEN_QUIETS;
+                [[fallthrough]];
+
+            case STAGE_GEN_QUIETS:
+                movegen::legalmoves<movegen::MoveGenType::QUIET>(quiets, board);
+                for (auto& move : quiets) {
+                    score_quiet(move);
+                }
+                stage = STAGE_QUIETS;
+                [[fallthrough]];
+
+            case STAGE_QUIETS:
+                while (quiet_index < quiets.size()) {
+                    Move move = pick_best(quiets, quiet_index);
+                    if (move == tt_move || move == refutations[0] || move == refutations[1] || move == refutations[2]) continue;
+                    return move;
+                }
+                stage = STAGE_BAD_CAPTURES;
+                [[fallthrough]];
+
+            case STAGE_BAD_CAPTURES:
+                // already in order, they were parked as they were picked
+                while (bad_capture_index < bad_capture_end) {
+                    return captures[bad_capture_index++];
+                }
+                stage = STAGE_DONE;
+                [[fallthrough]];
+
+            case STAGE_DONE:
+            default:
+                return Move::NO_MOVE;
+        }
+    }
+
+   private:
+    // The tt move comes from a 16 bit verified slot and can belong to another position,
+    // so it is checked against the legal moves of its piece type only
+    bool is_legal(Move move) const {
+        if (move == Move::NO_MOVE) return false;
+
+        Piece piece = board.at(move.from());
+        if (piece == Piece::NONE || piece.color() != board.sideToMove()) return false;
+
+        Movelist moves;
+        movegen::legalmoves(moves, board, 1 << static_cast<int>(piece.type()));
+        return std::find(moves.begin(), moves.end(), move) != moves.end();
+    }
+
+    // Empty, the tt move, or already handed out as an earlier refutation
+    bool is_refutation_duplicate(Move move) const {
+        if (move == Move::NO_MOVE || move == tt_move) return true;
+        for (int i = 0; i < refutation_index - 1; ++i) {
+            if (refutations[i] == move) return true;
+        }
+        return false;
+    }
+
+    // Pushes to the last rank are generated as quiets, qsearch still wants to see them
+    void add_quiet_queen_promotions() {
+        Color us = board.sideToMove();
+        if (!(board.pieces(PieceType::PAWN, us) & Bitboard(Rank::rank(Rank::RANK_7, us).bb()))) return;
+
+        // the quiet list is otherwise unused in captures_only mode
+        movegen::legalmoves<movegen::MoveGenType::QUIET>(quiets, board, PieceGenType::PAWN);
+        for (const auto& move : quiets) {
+            if (move.typeOf() == Move::PROMOTION && move.promotionType() == PieceType::QUEEN) {
+                captures.add(move);
+            }
+        }
+    }
+
+    // MVV-LVA, most valuable victim first and least valuable attacker breaks ties,
+    // shifted by how well this capture has done so far in the search
+    void score_capture(Move& move) const {
+        PieceType victim = HistoryTables::captured_type(board, move);
+        int score = get_piece_value(victim) * 8 - static_cast<int>(board.at<PieceType>(move.from()));
+        score += history.capture_score(board, move) / 8;
+
+        if (move.typeOf() == Move::PROMOTION) {
+            score += get_piece_value(move.promotionType()) * 8;
+        }
+        move.setScore(static_cast<int16_t>(score));
+    }
 
-    TranspositionTableEntry() : hash_key(0), depth(0), bestmove(Move::NO_MOVE) {}
+    // by history, promotions first
+    void score_quiet(Move& move) const {
+        if (move.typeOf() == Move::PROMOTION) {
+            move.setScore(static_cast<int16_t>(3 * HISTORY_MAX / 2 + get_piece_value(move.promotionType())));
+            return;
+        }
+        // halved, three tables summed would not fit in the 16 bit score
+        move.setScore(static_cast<int16_t>(history.quiet_score(board.sideToMove(), move, board.at(move.from()), cont_hist) / 2));
+    }
+
+    // Swaps the highest scored move left in list[index..] to list[index] and returns it
+    static Move pick_best(Movelist& list, int& index) {
+        int best = index;
+        for (int i = index + 1; i < list.size(); ++i) {
+            if (list[i].score() > list[best].score()) best = i;
+        }
+        std::swap(list[index], list[best]);
+        return list[index++];
+    }
+
+    const Board& board;
+    const HistoryTables& history;
+    const PieceToHistory* cont_hist[2];
+    Move tt_move;
+    Move refutations[3];
+    int refutation_index = 0;
+    bool captures_only;
+    int stage;
+
+    Movelist captures;
+    int capture_index = 0;
+    int bad_capture_end = 0;
+    int bad_capture_index = 0;
+
+    Movelist quiets;
+    int quiet_index = 0;
 };
 
-const int TT_SIZE_DEFAULT = /*size mb: */16 * 1024 * 1024 / sizeof(TranspositionTableEntry);
-std::vector<TranspositionTableEntry> transposition_table;
+// Bound type of a stored score: EXACT lies inside the window, LOWER failed high, UPPER failed low
+enum TTBound : uint8_t {
+    BOUND_NONE,
+    BOUND_UPPER,
+    BOUND_LOWER,
+    BOUND_EXACT,
+};
+
+// Compact 10 byte entry, only 16 bits of the key are kept since the rest is implied by the cluster index.
+// The table is shared between search threads without locks: key16 is stored xored with the other fields,
+// so an entry torn by a concurrent write fails verification instead of returning mixed data.
+struct TTEntry {
+    uint16_t key16;
+    uint16_t move16;
+    int16_t score16;
+    int16_t eval16;
+    uint8_t depth8;
+    uint8_t genbound8; // generation in the upper 6 bits, bound in the lower 2
+
+    Move bestmove() const { return Move(move16); }
+    int score() const { return score16; }
+    int static_eval() const { return eval16; }
+    int depth() const { return depth8; }
+    TTBound bound() const { return static_cast<TTBound>(genbound8 & 0x3); }
+
+    uint16_t data_hash() const { return move16 ^ static_cast<uint16_t>(score16) ^ static_cast<uint16_t>(eval16) ^ (depth8 | genbound8 << 8); }
+    bool matches(uint16_t key) const { return (key16 ^ data_hash()) == key && bound() != BOUND_NONE; }
+};
+static_assert(sizeof(TTEntry) == 10, "TTEntry must stay packed");
+
+// One cache line, so a probe never touches more than one line of memory.
+// The first CLUSTER_SIZE - 1 slots are depth-preferred, the last one is always replaced.
+const int CLUSTER_SIZE = 6;
+
+struct alignas(64) TTCluster {
+    TTEntry entries[CLUSTER_SIZE];
+    char padding[4];
+};
+static_assert(sizeof(TTCluster) == 64, "TTCluster must fill exactly one cache line");
+
+const int TT_SIZE_MB_DEFAULT = 16;
+std::vector<TTCluster> transposition_table;
+
+// bumped by GENERATION_DELTA on every "go" so entries from earlier searches can be told apart and replaced first
+const uint8_t GENERATION_DELTA = 4;
+const uint8_t GENERATION_MASK = 0xFC;
+const int GENERATION_CYCLE = 255 + GENERATION_DELTA;
+uint8_t tt_generation = 0;
+
+void tt_resize(size_t size_mb) {
+    transposition_table.assign(size_mb * 1024 * 1024 / sizeof(TTCluster), TTCluster());
+}
+
+void tt_clear() {
+    std::fill(transposition_table.begin(), transposition_table.end(), TTCluster());
+}
 
 // thanks aletheia
 [[nodiscard]] inline uint64_t table_index(uint64_t hash) {
     return static_cast<uint64_t>((static_cast<unsigned __int128>(hash) * static_cast<unsigned __int128>(transposition_table.size())) >> 64);
 }
 
-TranspositionTableEntry probe_entry(uint64_t hash_key) {
-    uint64_t index = table_index(hash_key);
-    TranspositionTableEntry entry;
+// How valuable an entry is to keep: deep results are worth more, every search it survived costs it 8 plies
+int replace_value(const TTEntry& entry) {
+    if (entry.bound() == BOUND_NONE) return std::numeric_limits<int>::min();
 
-    if (transposition_table[index].hash_key == hash_key) entry = transposition_table[index];
+    int age = ((GENERATION_CYCLE + tt_generation - entry.genbound8) & GENERATION_MASK) / GENERATION_DELTA;
+    return entry.depth() - 8 * age;
+}
 
-    return entry;
+// Mate scores are stored relative to the node instead of the root, so an entry stays valid at any ply
+int score_to_tt(int score, int ply) {
+    if (score >= MATE_IN_MAX_PLY) return score + ply;
+    if (score <= -MATE_IN_MAX_PLY) return score - ply;
+    return score;
+}
+
+int score_from_tt(int score, int ply) {
+    if (score >= MATE_IN_MAX_PLY) return score - ply;
+    if (score <= -MATE_IN_MAX_PLY) return score + ply;
+    return score;
 }
 
-void store_entry(uint64_t hash_key, int depth, Move bestmove) {
-    int index = hash_key % TT_SIZE_DEFAULT;
-    TranspositionTableEntry& entry = transposition_table[index];
+// Returns the stored entry, or an empty entry (bound BOUND_NONE) if the cluster does not hold this position
+TTEntry probe_entry(uint64_t hash_key) {
+    const TTCluster& cluster = transposition_table[table_index(hash_key)];
+    const uint16_t key16 = static_cast<uint16_t>(hash_key);
+
+    for (const TTEntry& slot : cluster.entries) {
+        // copy first, another thread may be writing this slot while we verify it
+        const TTEntry entry = slot;
+        if (entry.matches(key16)) return entry;
+    }
+    return TTEntry();
+}
+
+void store_entry(uint64_t hash_key, int depth, int ply, int score, TTBound bound, int static_eval, Move bestmove) {
+    TTCluster& cluster = transposition_table[table_index(hash_key)];
+    const uint16_t key16 = static_cast<uint16_t>(hash_key);
+
+    TTEntry* replace = nullptr;
+    for (TTEntry& entry : cluster.entries) {
+        if (entry.matches(key16)) {
+            replace = &entry;
+            break;
+        }
+    }
+
+    if (replace) {
+        // keep deeper results for the same position from this search, unless we now have an exact score
+        if ((replace->genbound8 & GENERATION_MASK) == tt_generation && depth < replace->depth() && bound != BOUND_EXACT) {
+            return;
+        }
+    } else {
+        replace = &cluster.entries[0];
+        for (int i = 1; i < CLUSTER_SIZE - 1; ++i) {
+            if (replace_value(cluster.entries[i]) < replace_value(*replace)) {
+                replace = &cluster.entries[i];
+            }
+        }
+
+        // every depth-preferred slot is worth more than this result, so it goes to the always-replace slot
+        if (replace_value(*replace) > depth) {
+            replace = &cluster.entries[CLUSTER_SIZE - 1];
+        }
+    }
 
-    if (depth >= entry.depth && entry.hash_key != hash_key) {
-        entry.hash_key = hash_key;
-        entry.depth = depth;
-        entry.bestmove = bestmove;
+    TTEntry entry = *replace;
+
+    // a fail-low finds no best move, so keep the one we already had
+    if (bestmove != Move::NO_MOVE || !entry.matches(key16)) {
+        entry.move16 = bestmove.move();
     }
+    entry.score16 = static_cast<int16_t>(score_to_tt(score, ply));
+    entry.eval16 = static_cast<int16_t>(static_eval);
+    entry.depth8 = static_cast<uint8_t>(std::clamp(depth, 0, 255));
+    entry.genbound8 = static_cast<uint8_t>(tt_generation | bound);
+    entry.key16 = key16 ^ entry.data_hash();
+
+    *replace = entry;
 }
 
-int evaluate(const chess::Board board, int depth) {
+int evaluate(const chess::Board& board, int depth) {
     int score = 0;
     // HCE Filters
     score += hce_pieces(board);
@@ -211,45 +620,285 @@ int evaluate(const chess::Board board, int depth) {
     return score;
 }
 
-int qsearch(Board board, int depth_real, int alpha, int beta, std::chrono::_V2::system_clock::time_point start_time, int max_time) {
-    auto current_time = std::chrono::high_resolution_clock::now();
-    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
+// --- Time Management ---
+// What "go" asked for, times in ms, -1 when not given
+struct SearchLimits {
+    int max_depth = 99;
+    bool depth_given = false; // "go depth" was sent, so no default time limit
+    int time[2] = {-1, -1}; // remaining clock, indexed by color
+    int inc[2] = {0, 0};
+    int movestogo = 0;
+    int movetime = -1;
+};
 
-    if (elapsed_ms >= max_time) {
-        return 0; // doesnt matter because the results get discarded anyway
+// written before the helpers are woken up, read-only while searching
+SearchLimits search_limits;
+
+const int TM_MOVES_HORIZON = 40; // moves we plan for in sudden death, and at most with movestogo
+const int TM_MAX_RATIO = 5; // the hard limit is at most this many times the optimum
+const int TM_DEFAULT_MOVETIME = 1500; // a bare "go"
+
+// Scales for the optimum after each iteration: by how many iterations in a row the best move stayed the same,
+// by the share of nodes the best move took (a clear best move gets most of them), and by how far the score fell
+const double TM_STABILITY_SCALE[5] = {1.5, 1.25, 1.0, 0.9, 0.8};
+const double TM_NODE_FRACTION_BASE = 1.5;
+const double TM_NODE_FRACTION_MULTIPLIER = 1.35;
+const double TM_SCORE_DROP_PER_CP = 0.005;
+const double TM_SCORE_SCALE_MIN = 0.85;
+const double TM_SCORE_SCALE_MAX = 1.5;
+
+// Two limits per search: the optimum (soft) one is checked between iterations, no new iteration starts
+// after it. The maximum (hard) one ends the search wherever it is, through the stop flag.
+class TimeManager {
+public:
+    int move_overhead = 10; // ms lost per move between us and the clock, set by the MoveOverhead option
+
+    void init(const SearchLimits& limits, Color us) {
+        start_time = std::chrono::high_resolution_clock::now();
+        is_limited = true;
+
+        const int time = limits.time[us];
+        const int inc = limits.inc[us];
+
+        is_dynamic = false;
+
+        if (limits.movetime >= 0) {
+            optimum_ms = maximum_ms = std::max(1, limits.movetime - move_overhead);
+            scaled_optimum_ms = optimum_ms;
+            return;
+        }
+
+        if (time < 0) {
+            // only a depth limit, or nothing at all
+            is_limited = !limits.depth_given;
+            optimum_ms = maximum_ms = is_limited ? TM_DEFAULT_MOVETIME : std::numeric_limits<int64_t>::max();
+            scaled_optimum_ms = optimum_ms;
+            return;
+        }
+
+        // spread what we have, plus the increments still to come, over the moves left until the next control,
+        // keeping back the overhead of every one of them
+        const int moves_to_go = limits.movestogo > 0 ? std::min(limits.movestogo, TM_MOVES_HORIZON) : TM_MOVES_HORIZON;
+        const int64_t time_left = std::max<int64_t>(1, time + int64_t(inc) * (moves_to_go - 1) - int64_t(move_overhead) * (moves_to_go + 1));
+        optimum_ms = time_left / moves_to_go;
+
+        // never more than 4/5 of the clock that is actually there, so counting on increments
+        // can't flag us when the clock is low
+        const int64_t clock_cap = std::max<int64_t>(1, int64_t(time) * 4 / 5 - move_overhead);
+        maximum_ms = std::max<int64_t>(1, std::min(optimum_ms * TM_MAX_RATIO, clock_cap));
+        optimum_ms = std::max<int64_t>(1, std::min(optimum_ms, maximum_ms));
+        scaled_optimum_ms = optimum_ms;
+        is_dynamic = true;
+    }
+
+    // Called after every iteration with what it found out. Only clock play is scaled,
+    // a fixed movetime is used as given.
+    void update(int best_move_stability, double best_move_node_fraction, int score_drop) {
+        if (!is_dynamic) {
+            return;
+        }
+
+        const double stability_scale = TM_STABILITY_SCALE[std::min(best_move_stability, 4)];
+        const double node_scale = (TM_NODE_FRACTION_BASE - best_move_node_fraction) * TM_NODE_FRACTION_MULTIPLIER;
+        const double score_scale = std::clamp(1.0 + score_drop * TM_SCORE_DROP_PER_CP, TM_SCORE_SCALE_MIN, TM_SCORE_SCALE_MAX);
+
+        scaled_optimum_ms = std::min<int64_t>(optimum_ms * stability_scale * node_scale * score_scale, maximum_ms);
+    }
+
+    int64_t elapsed() const {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    }
+
+    // false for a search that only ends on depth
+    bool limited() const { return is_limited; }
+    bool soft_limit_reached() const { return is_limited && elapsed() >= scaled_optimum_ms; }
+    bool hard_limit_reached() const { return is_limited && elapsed() >= maximum_ms; }
+
+private:
+    std::chrono::high_resolution_clock::time_point start_time;
+    int64_t optimum_ms = 0;
+    int64_t scaled_optimum_ms = 0;
+    int64_t maximum_ms = 0;
+    bool is_limited = false;
+    bool is_dynamic = false; // clock play, where the optimum gets scaled
+};
+
+TimeManager time_manager;
+
+// --- Threads ---
+
+// Per ply search state, indexed by ply from the root
+struct SearchStack {
+    Move move = Move::NO_MOVE; // move played from this ply, Move::NULL_MOVE for a null move
+    Piece piece = Piece::NONE; // the piece that made it
+    PieceToHistory* cont_hist = nullptr; // continuation history table of that move, for the plies after it
+    int static_eval = SCORE_NONE;
+    Move killers[2] = {Move::NO_MOVE, Move::NO_MOVE};
+    int extensions = 0; // plies extended on the way from the root to this node
+    bool improving = false; // static eval is better than at our previous move, two plies back
+    Move excluded_move = Move::NO_MOVE; // skipped by the singular extension search at this ply
+};
+
+// A legal move at the root and what the iterations so far found out about it
+struct RootMove {
+    Move move;
+    int score = -SCORE_INFINITY; // -SCORE_INFINITY unless it was the first move or beat alpha in the last search
+    int previous_score = -SCORE_INFINITY; // score at the end of the previous iteration
+    uint64_t nodes = 0; // nodes spent below this move, over all iterations
+    std::vector<Move> pv;
+
+    explicit RootMove(Move move) : move(move), pv{move} {}
+
+    // best result first, ties broken by the previous iteration and then by effort,
+    // a move that needed a bigger tree is more likely to be a real alternative
+    bool operator<(const RootMove& other) const {
+        if (score != other.score) return score > other.score;
+        if (previous_score != other.previous_score) return previous_score > other.previous_score;
+        return nodes > other.nodes;
     }
+};
 
-    int standPat = evaluate(board, depth_real); 
+// Lazy SMP: every thread runs its own iterative deepening on its own board and they only
+// share work through the tt. Thread 0 is the uci thread itself, the rest are persistent helpers.
+// Aligned to a cache line so the node counters and boards of different threads never share one.
+struct alignas(64) SearchThread {
+    int id;
+    Board board;
+    std::atomic<uint64_t> nodes{0};
+
+    std::array<SearchStack, MAX_PLY + 1> stack;
+    std::vector<RootMove> root_moves;
+    int root_depth = 0;
+
+    // Triangular pv table: pv_table[ply] holds the best line found from ply on, in pv_table[ply][ply..pv_length[ply]).
+    // Only pv nodes write to it.
+    Move pv_table[MAX_PLY + 1][MAX_PLY + 1];
+    int pv_length[MAX_PLY + 1];
+    HistoryTables history;
+
+    // beta cutoffs, and how many of them came from the first move searched
+    uint64_t cutoffs = 0;
+    uint64_t first_move_cutoffs = 0;
+    // null move pruning is disabled below this ply while a null move fail high is being verified
+    int nmp_min_ply = 0;
+    // nodes left until the main thread reads the clock again
+    int time_check_countdown = 0;
+
+    std::thread native;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool searching = false;
+    bool exit = false;
+
+    explicit SearchThread(int id) : id(id) {
+        history.clear();
+        if (id > 0) native = std::thread(&SearchThread::idle_loop, this);
+    }
 
-    if (standPat >= beta) {
-        return beta;
+    ~SearchThread() {
+        if (!native.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            exit = true;
+        }
+        cv.notify_all();
+        native.join();
+    }
+
+    // only this thread writes its counter, so a plain load/store is enough and avoids a locked add per node
+    void count_node() { nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    void start_searching() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            searching = true;
+        }
+        cv.notify_all();
     }
-    if (standPat > alpha) {
-        alpha = standPat;
+
+    void wait_for_search_finished() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return !searching; });
+    }
+
+    void idle_loop();
+};
+
+std::vector<std::unique_ptr<SearchThread>> threads;
+
+void set_threads(int count) {
+    threads.clear();
+    for (int i = 0; i < count; ++i) {
+        threads.push_back(std::make_unique<SearchThread>(i));
+    }
+}
+
+void clear_history() {
+    for (auto& thread : threads) {
+        thread->history.clear();
+    }
+}
+
+uint64_t total_nodes() {
+    uint64_t sum = 0;
+    for (const auto& thread : threads) {
+        sum += thread->nodes.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// Reading the clock at every node costs more than it's worth, so the main thread does it every
+// TIME_CHECK_INTERVAL nodes and raises the stop flag for everyone, the helpers never look at it
+void check_time(SearchThread& thread) {
+    if (thread.id != 0 || --thread.time_check_countdown > 0) {
+        return;
+    }
+    thread.time_check_countdown = TIME_CHECK_INTERVAL;
+
+    if (time_manager.hard_limit_reached()) {
+        search_stopped = true;
     }
+}
+
+int qsearch(SearchThread& thread, int depth_real, int alpha, int beta) {
+    Board& board = thread.board;
 
-    Movelist movelist;
-    movegen::legalmoves(movelist, board);
-    std::vector<Move> moves = sortMovesMVVLVA(movelist, board);
+    check_time(thread);
+    if (search_stopped.load(std::memory_order_relaxed)) {
+        return 0; // doesnt matter because the results get discarded anyway
+    }
 
+    // Draw conditions, before we spend anything on eval or move generation
     if(board.isRepetition() || board.isInsufficientMaterial() || board.isHalfMoveDraw()){
         return 0;
     }
 
-    std::vector<chess::Move> captureMoves;
-    for (const auto& move : moves) {
-        if (board.isCapture(move)) {
-            captureMoves.push_back(move);
+    // In check there is no stand pat, every evasion has to be searched
+    const bool in_check = board.inCheck();
+
+    if (!in_check) {
+        int standPat = evaluate(board, depth_real);
+
+        if (standPat >= beta) {
+            return beta;
+        }
+        if (standPat > alpha) {
+            alpha = standPat;
         }
     }
 
-    int maxScore = standPat;
+    // captures that don't lose material and queen promotions, or all evasions when in check
+    MovePicker picker(board, thread.history, !in_check);
+    int legal_moves = 0;
+
+    Move move;
+    while ((move = picker.next()) != Move::NO_MOVE) {
+        legal_moves++;
 
-    for (const auto& move : captureMoves) {
         board.makeMove(move);
-        nodes++;
+        thread.count_node();
 
-        int score = -qsearch(board, depth_real+1, -beta, -alpha, start_time, max_time);
+        int score = -qsearch(thread, depth_real+1, -beta, -alpha);
 
         board.unmakeMove(move);
 
@@ -260,92 +909,392 @@ int qsearch(Board board, int depth_real, int alpha, int beta, std::chrono::_V2::
             alpha = score;
         }
     }
+
+    if (in_check && legal_moves == 0) {
+        return -MATE_SCORE + depth_real;
+    }
     return alpha;
 }
 
-int negamax(chess::Board board, int depth, int depth_real, int alpha, int beta, std::chrono::_V2::system_clock::time_point start_time, int max_time) {
-    if (depth <= 0) {
-        return qsearch(board, depth_real+1, -beta, -alpha, start_time, max_time);
+// Any beta cutoff: reward the best move if it was a capture or promotion, and punish those searched before it
+void update_capture_stats(SearchThread& thread, int depth, Move move, bool is_quiet, const Move* captures_searched, int capture_count) {
+    int bonus = history_bonus(depth);
+    if (!is_quiet) {
+        thread.history.update_capture(thread.board, move, bonus);
+    }
+    for (int i = 0; i < capture_count; ++i) {
+        thread.history.update_capture(thread.board, captures_searched[i], -bonus);
     }
-    auto current_time = std::chrono::high_resolution_clock::now();
-    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
+}
 
-    if (elapsed_ms >= max_time) {
-        return 0; // doesnt matter because the results get discarded anyway
+// A quiet move caused a beta cutoff: remember it as a killer for this ply and as the counter to the previous
+// move, reward it and punish the quiets that were searched before it without success
+void update_quiet_stats(SearchThread& thread, int ply, int depth, Move move, const Move* quiets_searched, int quiet_count, PieceToHistory* const cont_hist[2]) {
+    SearchStack& ss = thread.stack[ply];
+    const SearchStack& prev = thread.stack[ply - 1];
+    const Color us = thread.board.sideToMove();
+
+    if (ss.killers[0] != move) {
+        ss.killers[1] = ss.killers[0];
+        ss.killers[0] = move;
     }
 
-    Movelist movelist;
-    movegen::legalmoves(movelist, board);
+    if (prev.move != Move::NO_MOVE && prev.move != Move::NULL_MOVE) {
+        thread.history.counter_moves[prev.piece][prev.move.to().index()] = move;
+    }
 
-    if (movelist.empty()) {
-        if (board.isAttacked(board.kingSq(board.sideToMove()), !board.sideToMove())) {
-            return -MATE_SCORE;
-        }
-        if (board.isAttacked(board.kingSq(!board.sideToMove()), board.sideToMove())) {
-            return MATE_SCORE;
-        }
-        return 0; // Stalemate
+    const Board& board = thread.board;
+    int bonus = history_bonus(depth);
+    thread.history.update_quiet(us, move, board.at(move.from()), cont_hist, bonus);
+    for (int i = 0; i < quiet_count; ++i) {
+        thread.history.update_quiet(us, quiets_searched[i], board.at(quiets_searched[i].from()), cont_hist, -bonus);
+    }
+}
+
+// move is the new best move at ply, so the line from here becomes it followed by the child's line
+void update_pv(SearchThread& thread, int ply, Move move) {
+    thread.pv_table[ply][ply] = move;
+    for (int i = ply + 1; i < thread.pv_length[ply + 1]; ++i) {
+        thread.pv_table[ply][i] = thread.pv_table[ply + 1][i];
+    }
+    thread.pv_length[ply] = std::max(thread.pv_length[ply + 1], ply + 1);
+}
+
+// PV nodes are searched with an open window and can still end up on the principal variation,
+// NonPV nodes are searched with a null window and only have to prove a bound
+enum NodeType { NonPV, PV };
+
+// Templated on the node type so the pv checks all over the hot path are compile time constants
+template <NodeType node_type>
+int negamax(SearchThread& thread, int depth, int depth_real, int alpha, int beta) {
+    constexpr bool pv_node = node_type == PV;
+    Board& board = thread.board;
+
+    // empty until a move beats alpha, which also covers every early return
+    if (pv_node) {
+        thread.pv_length[depth_real] = depth_real;
     }
-    
-    // Draw conditions
+
+    if (depth <= 0) {
+        return qsearch(thread, depth_real, alpha, beta);
+    }
+    check_time(thread);
+    if (search_stopped.load(std::memory_order_relaxed)) {
+        return 0; // doesnt matter because the results get discarded anyway
+    }
+
+    // Draw conditions, checked before the tt so a stored score never hides a repetition
     if(board.isRepetition() || board.isInsufficientMaterial() || board.isHalfMoveDraw()){
         return 0;
     }
 
-    int maxScore = -INFINITY;
-    Move thisBestMove = Move::NO_MOVE;
+    // Mate distance pruning: even mating right here can't beat a shorter mate already found higher up,
+    // and being mated right here can't be worse than a faster mate we already avoid
+    alpha = std::max(alpha, -MATE_SCORE + depth_real);
+    beta = std::min(beta, MATE_SCORE - depth_real - 1);
+    if (alpha >= beta) {
+        return alpha;
+    }
 
+    const int alpha_orig = alpha;
     uint64_t zobrist = board.hash();
-    TranspositionTableEntry entry = probe_entry(zobrist);
-    Move bestmove = entry.bestmove;
-    if(entry.depth >= depth_real) {
-        board.makeMove(bestmove);
-        nodes++;
+    TTEntry entry = probe_entry(zobrist);
+    SearchStack& ss = thread.stack[depth_real];
+    const Move excluded_move = ss.excluded_move;
+
+    // no cutoffs in pv nodes, so the principal variation is always actually searched,
+    // and none in a singular search, the entry is about the very move it leaves out
+    if (use_tt && !pv_node && excluded_move == Move::NO_MOVE && entry.bound() != BOUND_NONE && entry.depth() >= depth) {
+        int tt_score = score_from_tt(entry.score(), depth_real);
+
+        if (entry.bound() == BOUND_EXACT
+            || (entry.bound() == BOUND_LOWER && tt_score >= beta)
+            || (entry.bound() == BOUND_UPPER && tt_score <= alpha)) {
+            return tt_score;
+        }
+    }
 
-        int score = -negamax(board, depth - 1, depth_real + 1, -beta, -alpha, start_time, max_time);
+    if (depth_real >= MAX_PLY) {
+        return evaluate(board, depth_real);
+    }
 
-        board.unmakeMove(bestmove);
+    // static eval once per node, from the tt if we have it, and kept on the stack for the rest of the search
+    const bool in_check = board.inCheck();
+    int static_eval = SCORE_NONE;
+    if (!in_check) {
+        // an entry written in check has no eval, and with 16 key bits it can still collide with this node
+        static_eval = entry.bound() != BOUND_NONE && entry.static_eval() != SCORE_NONE
+                    ? entry.static_eval() : evaluate(board, depth_real);
+    }
+    ss.static_eval = static_eval;
+
+    // Improving: compared to our last move, skipping back over a ply where we were in check and had no eval.
+    // When it's going up, fail highs are more trustworthy and fail lows less so.
+    ss.improving = false;
+    if (!in_check) {
+        if (depth_real >= 2 && thread.stack[depth_real - 2].static_eval != SCORE_NONE) {
+            ss.improving = static_eval > thread.stack[depth_real - 2].static_eval;
+        } else if (depth_real >= 4 && thread.stack[depth_real - 4].static_eval != SCORE_NONE) {
+            ss.improving = static_eval > thread.stack[depth_real - 4].static_eval;
+        } else {
+            ss.improving = true;
+        }
+    }
+    const bool improving = ss.improving;
 
-        if (score >= maxScore) {
-            maxScore = score;
-            thisBestMove = bestmove;
+    // Reverse futility pruning: this far above beta at shallow depth, the opponent won't get back in time
+    if (!pv_node && !in_check && excluded_move == Move::NO_MOVE && depth <= RFP_MAX_DEPTH
+        && std::abs(beta) < MATE_IN_MAX_PLY
+        && static_eval - RFP_MARGIN * (depth - improving) >= beta) {
+        return static_eval;
+    }
+
+    // Null move pruning: if we pass and a reduced search still fails high, a real move almost certainly would too.
+    // Not in check (passing would be illegal), not twice in a row, and not with only pawns left where
+    // zugzwang makes passing the best move. Deep cutoffs are verified by a normal reduced search.
+    if (!pv_node && !in_check && excluded_move == Move::NO_MOVE && depth >= NMP_MIN_DEPTH && static_eval >= beta
+        && thread.stack[depth_real - 1].move != Move::NULL_MOVE
+        && depth_real >= thread.nmp_min_ply
+        && board.hasNonPawnMaterial(board.sideToMove())) {
+        int reduction = 3 + depth / 4 + std::min((static_eval - beta) / 200, 3);
+
+        thread.stack[depth_real + 1].extensions = ss.extensions;
+        ss.move = Move::NULL_MOVE;
+        ss.piece = Piece::NONE;
+        ss.cont_hist = thread.history.sentinel();
+        board.makeNullMove();
+        thread.count_node();
+
+        int null_score = -negamax<NonPV>(thread, depth - reduction, depth_real + 1, -beta, -beta + 1);
+
+        board.unmakeNullMove();
+
+        if (search_stopped) {
+            return 0;
         }
 
-        alpha = std::max(alpha, score);
+        if (null_score >= beta) {
+            // a mate found after passing is not a real mate
+            if (null_score >= MATE_IN_MAX_PLY) {
+                null_score = beta;
+            }
+
+            if (thread.nmp_min_ply != 0 || depth < NMP_VERIFICATION_DEPTH) {
+                return null_score;
+            }
+
+            thread.nmp_min_ply = depth_real + 3 * (depth - reduction) / 4;
+            int verification = negamax<NonPV>(thread, depth - reduction, depth_real, beta - 1, beta);
+            thread.nmp_min_ply = 0;
+
+            if (verification >= beta) {
+                return null_score;
+            }
+        }
     }
 
-    // move sorting
-    std::vector<Move> moves = sortMovesMVVLVA(movelist, board);
+    int maxScore = -SCORE_INFINITY;
+    Move thisBestMove = Move::NO_MOVE;
+    int legal_moves = 0;
+
+    // moves searched before the cutoff, they get a history malus
+    Move quiets_searched[64];
+    int quiet_count = 0;
+    Move captures_searched[32];
+    int capture_count = 0;
+
+    const Color us = board.sideToMove();
+    const SearchStack& prev = thread.stack[depth_real - 1];
+    Move counter = Move::NO_MOVE;
+    if (prev.move != Move::NO_MOVE && prev.move != Move::NULL_MOVE) {
+        counter = thread.history.counter_moves[prev.piece][prev.move.to().index()];
+    }
+
+    PieceToHistory* const cont_hist[2] = {
+        prev.cont_hist,
+        depth_real >= 2 ? thread.stack[depth_real - 2].cont_hist : thread.history.sentinel(),
+    };
+
+    // a check with a single legal reply is forced, so that reply gets extended
+    bool single_reply = false;
+    if (in_check) {
+        Movelist evasions;
+        movegen::legalmoves(evasions, board);
+        single_reply = evasions.size() == 1;
+    }
 
-    for (const auto& move : moves) {
-        // skip the move tt already did
-        if(move == bestmove) {
+    // move ordering: tt move, good captures, killers and counter move, quiets by history, bad captures
+    MovePicker picker(board, thread.history, cont_hist, entry.bestmove(), ss.killers[0], ss.killers[1], counter);
+    Move move;
+
+    while ((move = picker.next()) != Move::NO_MOVE) {
+        if (move == excluded_move) {
+            continue;
+        }
+        legal_moves++;
+
+        const bool is_quiet = !board.isCapture(move) && move.typeOf() != Move::PROMOTION;
+        const Piece piece = board.at(move.from());
+        const int history_score = is_quiet ? thread.history.quiet_score(us, move, piece, cont_hist) : 0;
+        const int cont_score = is_quiet ? (*cont_hist[0])[piece][move.to().index()] + (*cont_hist[1])[piece][move.to().index()] : 0;
+        const bool gives_check = board.givesCheck(move) != CheckType::NO_CHECK;
+
+        // Continuation history pruning: at shallow depth, skip quiets that have kept failing after these two moves
+        if (!pv_node && !in_check && is_quiet && legal_moves > 1
+            && depth <= CHP_MAX_DEPTH
+            && maxScore > -MATE_IN_MAX_PLY
+            && cont_score < -CHP_MARGIN * depth) {
             continue;
         }
 
+        // Futility pruning: near the horizon a quiet move can't lift a static eval this far below alpha,
+        // unless it gives check
+        if (!pv_node && !in_check && is_quiet && legal_moves > 1
+            && depth <= FP_MAX_DEPTH
+            && maxScore > -MATE_IN_MAX_PLY
+            && static_eval + FP_BASE_MARGIN + FP_MARGIN * depth <= alpha
+            && !gives_check) {
+            continue;
+        }
+
+        // Extensions, at most root_depth extra plies along any line:
+        // a singular tt move, checks that don't lose material, and the only legal reply to a check
+        int extension = 0;
+
+        // Singular extensions: the tt says this move fails high. Search the other moves at reduced depth
+        // against a bound a bit below that score; if none of them reach it, the tt move is the only
+        // good one here and gets extended. If one does and the bound is still above beta, two moves
+        // beat beta and the node is cut right away (multi-cut).
+        if (move == entry.bestmove() && excluded_move == Move::NO_MOVE
+            && depth >= SE_MIN_DEPTH
+            && (entry.bound() == BOUND_LOWER || entry.bound() == BOUND_EXACT)
+            && entry.depth() >= depth - SE_TT_DEPTH_MARGIN) {
+            const int tt_score = score_from_tt(entry.score(), depth_real);
+
+            if (std::abs(tt_score) < MATE_IN_MAX_PLY) {
+                const int singular_beta = tt_score - 2 * depth;
+
+                ss.excluded_move = move;
+                int singular_score = negamax<NonPV>(thread, (depth - 1) / 2, depth_real, singular_beta - 1, singular_beta);
+                ss.excluded_move = Move::NO_MOVE;
+
+                if (search_stopped) {
+                    return 0;
+                }
+
+                if (singular_score < singular_beta) {
+                    extension = ss.extensions < thread.root_depth;
+                } else if (singular_beta >= beta) {
+                    return singular_beta;
+                }
+            }
+        }
+
+        if (extension == 0 && ss.extensions < thread.root_depth) {
+            if (single_reply || (gives_check && see(board, move, 0))) {
+                extension = 1;
+            }
+        }
+        thread.stack[depth_real + 1].extensions = ss.extensions + extension;
+
+        ss.move = move;
+        ss.piece = board.at(move.from());
+        ss.cont_hist = thread.history.continuation_table(ss.piece, move.to());
+        // a child only searched with a null window leaves no line behind
+        if (pv_node) {
+            thread.pv_length[depth_real + 1] = depth_real + 1;
+        }
         board.makeMove(move);
-        nodes++;
+        thread.count_node();
 
-        int score = -negamax(board, depth - 1, depth_real + 1, -beta, -alpha, start_time, max_time);
+        int new_depth = depth - 1 + extension;
+
+        // Principal Variation Search: the first move gets the full window, the rest only have to show
+        // they are no better than it with a null window and are re-searched if one turns out to be
+        int score;
+        if (legal_moves == 1) {
+            score = -negamax<node_type>(thread, new_depth, depth_real + 1, -beta, -alpha);
+        } else {
+            // Late move reductions: quiet moves this far down the ordering rarely matter, so they get a
+            // shallower null window search first and only a full depth one if they beat alpha anyway
+            int reduction = 0;
+            if (depth >= LMR_MIN_DEPTH && is_quiet && legal_moves > 1 + pv_node) {
+                reduction = lmr_reductions[depth][legal_moves];
+
+                if (pv_node) reduction--;
+                if (!improving) reduction++;
+                if (in_check || gives_check) reduction--;
+                reduction -= history_score / HISTORY_MAX;
+
+                reduction = std::clamp(reduction, 0, new_depth - 1);
+            }
+
+            score = -negamax<NonPV>(thread, new_depth - reduction, depth_real + 1, -alpha - 1, -alpha);
+
+            if (reduction > 0 && score > alpha) {
+                score = -negamax<NonPV>(thread, new_depth, depth_real + 1, -alpha - 1, -alpha);
+            }
+
+            if (pv_node && score > alpha && score < beta) {
+                score = -negamax<PV>(thread, new_depth, depth_real + 1, -beta, -alpha);
+            }
+        }
 
         board.unmakeMove(move);
 
-        if (score >= maxScore) {
+        if (search_stopped) {
+            return 0;
+        }
+
+        if (score > maxScore) {
             maxScore = score;
-            thisBestMove = move;
+
+            if (score > alpha) {
+                thisBestMove = move;
+                alpha = score;
+
+                if (pv_node) {
+                    update_pv(thread, depth_real, move);
+                }
+            }
         }
 
-        alpha = std::max(alpha, score);
         if (alpha >= beta) {
+            thread.cutoffs++;
+            thread.first_move_cutoffs += legal_moves == 1;
+
+            if (is_quiet) {
+                update_quiet_stats(thread, depth_real, depth, move, quiets_searched, quiet_count, cont_hist);
+            }
+            update_capture_stats(thread, depth, move, is_quiet, captures_searched, capture_count);
             break;
         }
+
+        if (is_quiet && quiet_count < 64) {
+            quiets_searched[quiet_count++] = move;
+        } else if (!is_quiet && capture_count < 32) {
+            captures_searched[capture_count++] = move;
+        }
     }
 
-    // add tt entry for current move
+    if (legal_moves == 0) {
+        // only the excluded move was legal, which says nothing about the position itself
+        if (excluded_move != Move::NO_MOVE) {
+            return alpha;
+        }
+        if (board.inCheck()) {
+            return -MATE_SCORE + depth_real;
+        }
+        return 0; // Stalemate
+    }
 
-    if(entry.depth <= depth_real) {
-        store_entry(zobrist, depth_real, thisBestMove);
+    // add tt entry for current position, but not from a singular search, which left a move out
+    if (excluded_move != Move::NO_MOVE) {
+        return maxScore;
     }
+    TTBound bound = maxScore >= beta ? BOUND_LOWER : (maxScore > alpha_orig ? BOUND_EXACT : BOUND_UPPER);
+    store_entry(zobrist, depth, depth_real, maxScore, bound, static_eval, thisBestMove);
+
     return maxScore;
 }
 
@@ -384,139 +1333,378 @@ void handlePosition(std::istringstream& ss) {
     }
 }
 
-void handleGo(std::istringstream& ss) {
-    int max_depth = 99; // Default search depth
-    int max_time = 1500; // Default search time
+void handleSetOption(std::istringstream& ss) {
+    std::string token, name, value;
+    ss >> token; // Should be "name"
+
+    while (ss >> token && token != "value") {
+        name += (name.empty() ? "" : " ") + token;
+    }
+    ss >> value;
+
+    if (name == "Hash") {
+        tt_resize(std::clamp(std::stoi(value), 1, 65536));
+    } else if (name == "Threads") {
+        set_threads(std::clamp(std::stoi(value), 1, 256));
+    } else if (name == "MoveOverhead") {
+        time_manager.move_overhead = std::clamp(std::stoi(value), 0, 5000);
+    }
+}
 
-    int wtime = -1;
-    int btime = -1;
-    int winc = -1;
-    int binc = -1;
+// "cp x" for normal scores, "mate n" in moves (not plies) for mates, negative when we get mated
+std::string score_to_uci(int score) {
+    if (score >= MATE_IN_MAX_PLY) {
+        return "mate " + std::to_string((MATE_SCORE - score + 1) / 2);
+    }
+    if (score <= -MATE_IN_MAX_PLY) {
+        return "mate " + std::to_string(-(MATE_SCORE + score) / 2);
+    }
+    return "cp " + std::to_string(score);
+}
 
-    nodes = 0;
+// Helper threads skip some iterations so they are usually a depth ahead of or behind the main thread,
+// which spreads them over different parts of the tree instead of repeating its work
+const int SKIP_SIZE[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+const int SKIP_PHASE[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+// Searches the root moves in order with the window (alpha, beta), raising alpha as it goes, and returns the
+// best score. The first move gets the full window, the rest a null window and a re-search if they beat it.
+// A move only gets a score when it is the first one or beats alpha, the rest are left at -SCORE_INFINITY
+// so sorting afterwards puts the best move found first, even when the search was stopped halfway.
+int search_root(SearchThread& thread, int depth, int alpha, int beta) {
+    Board& board = thread.board;
+    int best_score = -SCORE_INFINITY;
+
+    for (size_t i = 0; i < thread.root_moves.size(); ++i) {
+        RootMove& root_move = thread.root_moves[i];
+        const Move move = root_move.move;
+        const uint64_t nodes_before = thread.nodes.load(std::memory_order_relaxed);
+
+        thread.stack[0].move = move;
+        thread.stack[0].piece = board.at(move.from());
+        thread.stack[0].cont_hist = thread.history.continuation_table(thread.stack[0].piece, move.to());
+        thread.pv_length[1] = 1;
+        board.makeMove(move);
+        thread.count_node();
 
-    std::string token;
-    while (ss >> token) {
-        if (token == "depth") {
-            ss >> max_depth;
-        }
-        else if (token == "movetime") {
-            ss >> token;
-            max_time = stoi(token);
-        }
-        else if (token == "wtime") {
-            ss >> token;
-            wtime = stoi(token);
-        }
-        else if (token == "btime") {
-            ss >> token;
-            btime = stoi(token);
-        }
-        else if (token == "winc") {
-            ss >> token;
-            winc = stoi(token);
-        }
-        else if (token == "binc") {
-            ss >> token;
-            binc = stoi(token);
+        int score;
+        if (i == 0) {
+            score = -negamax<PV>(thread, depth - 1, 1, -beta, -alpha);
+        } else {
+            score = -negamax<NonPV>(thread, depth - 1, 1, -alpha - 1, -alpha);
+            if (score > alpha && score < beta) {
+                score = -negamax<PV>(thread, depth - 1, 1, -beta, -alpha);
+            }
         }
-    }
 
-    if(board.sideToMove() == Color::WHITE) {
-        if(wtime != -1) {
-            max_time = wtime / 20;
+        board.unmakeMove(move);
+        root_move.nodes += thread.nodes.load(std::memory_order_relaxed) - nodes_before;
+
+        // the score of an aborted search is meaningless, keep what this move had
+        if (search_stopped) {
+            return best_score;
         }
-        if(winc != -1) {
-            max_time += winc; 
+
+        root_move.score = (i == 0 || score > alpha) ? score : -SCORE_INFINITY;
+        if (i == 0 || score > alpha) {
+            root_move.pv.assign(1, move);
+            root_move.pv.insert(root_move.pv.end(), &thread.pv_table[1][1], &thread.pv_table[1][thread.pv_length[1]]);
         }
-    } else {
-        if(btime != -1) {
-            max_time = btime / 20;
+
+        if (score > best_score) {
+            best_score = score;
+
+            if (score > alpha) {
+                alpha = score;
+            }
         }
-        if(binc != -1) {
-            max_time += binc; 
+
+        if (alpha >= beta) {
+            break;
         }
     }
 
-    Movelist all_legal_moves;
-    movegen::legalmoves(all_legal_moves, board);
+    return best_score;
+}
 
-    Move bestMoveOverall;
-    bestMoveOverall = all_legal_moves[0];
-    int bestEvalOverall = -INFINITY;
+Move iterativeDeepening(SearchThread& thread) {
+    const int max_depth = search_limits.max_depth;
+    std::vector<RootMove>& root_moves = thread.root_moves;
 
-    // Record the start time
-    auto start_time = std::chrono::high_resolution_clock::now();
+    if (root_moves.empty()) {
+        return Move::NO_MOVE;
+    }
+
+    // for the time manager: iterations in a row with the same best move, and the last iteration's score
+    Move last_best_move = Move::NO_MOVE;
+    int best_move_stability = 0;
+    int last_score = SCORE_NONE;
 
     // Iterative Deepening Loop
     for (int current_depth = 1; current_depth <= max_depth; ++current_depth) {
-        Move currentIterationBestMove = bestMoveOverall;
-        int currentIterationBestEval = -INFINITY;
-        bool iteration_completed = true;
+        if (thread.id > 0) {
+            int i = (thread.id - 1) % 20;
+            if (((current_depth + SKIP_PHASE[i]) / SKIP_SIZE[i]) % 2) {
+                continue;
+            }
+        }
 
-        for (const auto &move : all_legal_moves) {
-            board.makeMove(move);
-            nodes++;
+        thread.root_depth = current_depth;
+
+        for (auto& root_move : root_moves) {
+            root_move.previous_score = root_move.score;
+        }
+        const int previous_best = root_moves[0].previous_score;
+
+        // Aspiration windows: the score rarely moves far from one iteration to the next, so search a narrow
+        // window around the last one and only widen it, on the side that failed, when the score falls outside
+        int delta = ASP_WINDOW;
+        int alpha = -SCORE_INFINITY;
+        int beta = SCORE_INFINITY;
+        if (current_depth >= ASP_MIN_DEPTH && std::abs(previous_best) < MATE_IN_MAX_PLY) {
+            alpha = std::max(previous_best - delta, -SCORE_INFINITY);
+            beta = std::min(previous_best + delta, SCORE_INFINITY);
+        }
 
-            int eval = -negamax(board, current_depth - 1, 1, -INFINITY, INFINITY, start_time, max_time);
+        while (true) {
+            int score = search_root(thread, current_depth, alpha, beta);
 
-            board.unmakeMove(move);
+            // stable, so moves that tie keep the order they were searched in. Also done after a stop:
+            // a move that already beat the old best move in this iteration is worth playing
+            std::stable_sort(root_moves.begin(), root_moves.end());
 
-            if (eval > currentIterationBestEval) {
-                currentIterationBestEval = eval;
-                currentIterationBestMove = move;
+            if (search_stopped) {
+                break;
             }
 
-            auto current_time = std::chrono::high_resolution_clock::now();
-            auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
-
-            if (elapsed_ms >= max_time) {
-                iteration_completed = false;
+            if (score <= alpha) {
+                alpha = std::max(alpha - delta, -SCORE_INFINITY);
+            } else if (score >= beta) {
+                beta = std::min(beta + delta, SCORE_INFINITY);
+            } else {
                 break;
             }
+
+            delta += delta / 2;
         }
 
-        if (!iteration_completed) {
+        if (search_stopped) {
             break;
         }
-        auto current_time = std::chrono::high_resolution_clock::now();
-        auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(current_time - start_time).count();
-        int nps = nodes;
-        if((elapsed_ms / 1000) != 0) {
-            nps = static_cast<int>((nodes / (elapsed_ms / 1000)));
+
+        if (thread.id != 0) {
+            continue;
         }
-        bestEvalOverall = currentIterationBestEval;
-        bestMoveOverall = currentIterationBestMove;
 
-        if (current_depth == 1 && bestMoveOverall == Move()) {
-            if (!all_legal_moves.empty()) {
-                 bestMoveOverall = all_legal_moves[0];
-            }
+        auto elapsed_ms = time_manager.elapsed();
+        uint64_t nodes = total_nodes();
+        uint64_t nps = nodes;
+        if((elapsed_ms / 1000) != 0) {
+            nps = nodes / (elapsed_ms / 1000);
         }
         std::cout << "info"
                     << " depth " << current_depth
                     << " nodes " << nodes
                     << " time " << elapsed_ms
-                    << " score cp " << bestEvalOverall
+                    << " score " << score_to_uci(root_moves[0].score)
                     << " nps " << nps
-                    << " pv " << uci::moveToUci(bestMoveOverall)
-                    << std::endl;
+                    << " pv";
+        for (const auto& move : root_moves[0].pv) {
+            std::cout << " " << uci::moveToUci(move);
+        }
+        std::cout << std::endl;
+
+        best_move_stability = root_moves[0].move == last_best_move ? best_move_stability + 1 : 0;
+        last_best_move = root_moves[0].move;
+
+        const uint64_t thread_nodes = thread.nodes.load(std::memory_order_relaxed);
+        const double best_move_node_fraction = thread_nodes ? double(root_moves[0].nodes) / thread_nodes : 1.0;
+        const int score_drop = last_score == SCORE_NONE ? 0 : last_score - root_moves[0].score;
+        last_score = root_moves[0].score;
+
+        time_manager.update(best_move_stability, best_move_node_fraction, score_drop);
+
+        // the next iteration would take several times as long as this one, don't start it past the optimum
+        if (time_manager.soft_limit_reached()) {
+            break;
+        }
+    }
+
+    return root_moves[0].move;
+}
+
+void SearchThread::idle_loop() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return searching || exit; });
+
+        if (exit) return;
+
+        lock.unlock();
+        iterativeDeepening(*this);
+        lock.lock();
+
+        searching = false;
+        cv.notify_all();
+    }
+}
+
+// Runs one search of the current position on all threads, the main thread's best move is played
+Move run_search(const SearchLimits& limits) {
+    search_stopped = false;
+    tt_generation += GENERATION_DELTA;
+
+    search_limits = limits;
+    time_manager.init(limits, board.sideToMove());
+
+    Movelist root_legal_moves;
+    movegen::legalmoves(root_legal_moves, board);
+
+    // nothing to think about, save the clock
+    if (root_legal_moves.size() == 1 && time_manager.limited()) {
+        return root_legal_moves[0];
+    }
+
+    for (auto& thread : threads) {
+        thread->board = board;
+        thread->nodes = 0;
+        thread->root_moves.clear();
+        for (const auto& move : root_legal_moves) {
+            thread->root_moves.emplace_back(move);
+        }
+        thread->nmp_min_ply = 0;
+        thread->time_check_countdown = TIME_CHECK_INTERVAL;
+        thread->stack.fill(SearchStack());
+        thread->cutoffs = 0;
+        thread->first_move_cutoffs = 0;
+    }
+    for (size_t i = 1; i < threads.size(); ++i) {
+        threads[i]->start_searching();
+    }
+
+    Move bestmove = iterativeDeepening(*threads[0]);
+
+    // the main thread is done, the helpers only ever help it
+    search_stopped = true;
+    for (size_t i = 1; i < threads.size(); ++i) {
+        threads[i]->wait_for_search_finished();
+    }
+
+    return bestmove;
+}
+
+void handleGo(std::istringstream& ss) {
+    SearchLimits limits;
+
+    std::string token;
+    while (ss >> token) {
+        if (token == "depth") {
+            ss >> limits.max_depth;
+            // the LMR table and search stack only have MAX_PLY rows
+            limits.max_depth = std::clamp(limits.max_depth, 1, MAX_PLY - 1);
+            limits.depth_given = true;
+        }
+        else if (token == "movetime") {
+            ss >> token;
+            limits.movetime = stoi(token);
+        }
+        else if (token == "wtime") {
+            ss >> token;
+            limits.time[Color(Color::WHITE)] = stoi(token);
+        }
+        else if (token == "btime") {
+            ss >> token;
+            limits.time[Color(Color::BLACK)] = stoi(token);
+        }
+        else if (token == "winc") {
+            ss >> token;
+            limits.inc[Color(Color::WHITE)] = stoi(token);
+        }
+        else if (token == "binc") {
+            ss >> token;
+            limits.inc[Color(Color::BLACK)] = stoi(token);
+        }
+        else if (token == "movestogo") {
+            ss >> token;
+            limits.movestogo = stoi(token);
+        }
     }
 
-    if (bestMoveOverall.from() != chess::Square::NO_SQ) {
+    Move bestMoveOverall = run_search(limits);
+
+    if (bestMoveOverall != Move::NO_MOVE) {
         std::cout << "bestmove " << uci::moveToUci(bestMoveOverall) << std::endl;
     } else {
         std::cout << "bestmove 0000" << std::endl;
     }
 }
 
+// Fixed set of positions searched to a fixed depth, used to compare node counts and NPS between builds
+const char* BENCH_FENS[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+    "8/8/4k3/8/2p5/8/B2K4/8 w - - 0 1",
+    "r2q1rk1/pb1nbppp/1p2pn2/2pp4/2PP4/1PN1PN2/PB2BPPP/R2Q1RK1 w - - 0 10",
+};
+
+void handleBench(std::istringstream& ss) {
+    int bench_depth = 6;
+    ss >> bench_depth;
+
+    uint64_t bench_nodes = 0;
+    uint64_t cutoffs = 0;
+    uint64_t first_move_cutoffs = 0;
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    for (const char* fen : BENCH_FENS) {
+        board.setFen(fen);
+        tt_clear();
+        clear_history();
+
+        SearchLimits limits;
+        limits.max_depth = bench_depth;
+        limits.depth_given = true;
+        run_search(limits);
+        bench_nodes += total_nodes();
+
+        for (const auto& thread : threads) {
+            cutoffs += thread->cutoffs;
+            first_move_cutoffs += thread->first_move_cutoffs;
+        }
+    }
+
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - start_time).count();
+    std::cout << "bench nodes " << bench_nodes
+              << " time " << elapsed_ms
+              << " nps " << bench_nodes * 1000 / (elapsed_ms + 1)
+              << " first_move_cutoffs " << (cutoffs ? 100.0 * first_move_cutoffs / cutoffs : 0.0) << "%"
+              << std::endl;
+
+    board.setFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+}
+
 int main(int argc, char* argv[]) {
 
     std::string line;
     board = Board();
     board.setFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
 
-    transposition_table.resize(TT_SIZE_DEFAULT);
+    tt_resize(TT_SIZE_MB_DEFAULT);
+    set_threads(1);
+    init_reductions();
+
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        std::istringstream iss(argc > 2 ? argv[2] : "");
+        handleBench(iss);
+        threads.clear();
+        return 0;
+    }
 
     while (std::getline(std::cin, line)) {
         std::istringstream iss(line);
@@ -526,21 +1714,31 @@ int main(int argc, char* argv[]) {
         if (command == "uci") {
             std::cout << "id name Sense" << std::endl;
             std::cout << "id author Zander" << std::endl;
+            std::cout << "option name Hash type spin default " << TT_SIZE_MB_DEFAULT << " min 1 max 65536" << std::endl;
+            std::cout << "option name Threads type spin default 1 min 1 max 256" << std::endl;
+            std::cout << "option name MoveOverhead type spin default 10 min 0 max 5000" << std::endl;
             std::cout << "uciok" << std::endl;
         } else if (command == "isready") {
             std::cout << "readyok" << std::endl;
         } else if (command == "ucinewgame") {
             board.setFen("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-            // reset tt
-            std::fill(transposition_table.begin(), transposition_table.end(), TranspositionTableEntry());
+            // reset tt and move ordering history
+            tt_clear();
+            clear_history();
         } else if (command == "position") {
             handlePosition(iss);
+        } else if (command == "setoption") {
+            handleSetOption(iss);
         } else if (command == "go") {
             handleGo(iss);
+        } else if (command == "bench") {
+            handleBench(iss);
         } else if (command == "quit") {
             break;
         }
     }
 
+    // joins the helper threads
+    threads.clear();
     return 0;
 }